@@ -1,9 +1,30 @@
+#define _GNU_SOURCE   // For splice(), copy_file_range(), memmem(), memrchr()
 #include <stdio.h>    // For printf(), perror(), fgets()
 #include <stdlib.h>   // For malloc(), free(), exit()
 #include <string.h>   // For strlen(), strtok(), strcmp(), strdup()
+#include <stdint.h>   // For uintmax_t, uint64_t
+#include <ctype.h>    // For isalpha(), isdigit(), ... in [:class:] globs
+#include <errno.h>    // For errno, EINTR
 #include <unistd.h>   // For fork(), execvp(), chdir(), getcwd(), setenv(), pipe(), dup2()
-#include <sys/wait.h> // For wait()
-#include <fcntl.h>    // For open(), O_WRONLY, O_CREAT, O_TRUNC, O_APPEND
+#include <sys/wait.h> // For wait(), waitpid()
+#include <sys/stat.h> // For fstat()
+#include <fcntl.h>    // For open(), O_WRONLY, O_CREAT, O_TRUNC, O_APPEND, splice()
+#include <dirent.h>   // For DT_DIR, DT_LNK, DT_UNKNOWN
+#include <limits.h>   // For PATH_MAX
+#include <sys/syscall.h> // For SYS_getdents64, SYS_pidfd_open
+#include <sys/socket.h> // For socket(), bind(), listen(), accept4(), send()
+#include <sys/un.h>   // For struct sockaddr_un
+#include <sys/epoll.h> // For epoll_create1(), epoll_ctl(), epoll_wait()
+#include <sys/resource.h> // For getrlimit(), setrlimit()
+#include <signal.h>   // For kill(), SIGKILL
+#include <time.h>     // For time()
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h> // For SSE2/AVX2 intrinsics
+#define HAVE_X86_SIMD 1
+#endif
+
+#define TEXT_BUF_SIZE (128 * 1024)  // Read/write chunk size for the text builtins
+#define GLOB_DIRENT_BUF (1024 * 1024) // getdents64() buffer shared by every directory scanned
 
 // Structure to store local variables
 typedef struct {
@@ -39,48 +60,1161 @@ void addVar(VarTable *vt, const char *name, const char *value) {
     vt->size++;
 }
 
-char *getVar(VarTable *vt, const char *name) {
-    for (int i = 0; i < vt->size; i++) {
-        if (strcmp(vt->names[i], name) == 0) {
-            return vt->values[i];
+char *getVar(VarTable *vt, const char *name) {
+    for (int i = 0; i < vt->size; i++) {
+        if (strcmp(vt->names[i], name) == 0) {
+            return vt->values[i];
+        }
+    }
+    return NULL;
+}
+
+void freeVarTable(VarTable *vt) {
+    for (int i = 0; i < vt->size; i++) {
+        free(vt->names[i]);
+        free(vt->values[i]);
+    }
+    free(vt->names);
+    free(vt->values);
+}
+
+// Structure to store the arguments of one command line (NULL-terminated)
+typedef struct {
+    char **items;
+    int size;
+    int capacity;
+} ArgList;
+
+void initArgList(ArgList *al) {
+    al->items = (char **)malloc(64 * sizeof(char *));
+    al->size = 0;
+    al->capacity = 64;
+    if (al->items == NULL) {
+        perror("Memory allocation failed");
+        exit(1);
+    }
+    al->items[0] = NULL;
+}
+
+void addArg(ArgList *al, const char *arg) {
+    if (al->size + 1 >= al->capacity) {
+        al->capacity *= 2;
+        al->items = (char **)realloc(al->items, al->capacity * sizeof(char *));
+        if (al->items == NULL) {
+            perror("Memory reallocation failed");
+            exit(1);
+        }
+    }
+    al->items[al->size] = strdup(arg);
+    if (al->items[al->size] == NULL) {
+        perror("Memory allocation failed");
+        exit(1);
+    }
+    al->size++;
+    al->items[al->size] = NULL;
+}
+
+void freeArgList(ArgList *al) {
+    for (int i = 0; i < al->size; i++) {
+        free(al->items[i]);
+    }
+    free(al->items);
+}
+
+// Buffered stdout shared by the text builtins (cat, wc, head, grep -F)
+char textOut[TEXT_BUF_SIZE];
+size_t textOutLen = 0;
+
+int writeAll(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int flushOut(void) {
+    int rc = writeAll(STDOUT_FILENO, textOut, textOutLen);
+    textOutLen = 0;
+    return rc;
+}
+
+int writeOut(const char *buf, size_t len) {
+    if (textOutLen + len > sizeof(textOut)) {
+        if (flushOut() < 0) return -1;
+        if (len >= sizeof(textOut)) return writeAll(STDOUT_FILENO, buf, len);
+    }
+    memcpy(textOut + textOutLen, buf, len);
+    textOutLen += len;
+    return 0;
+}
+
+// Newline counting: scalar fallback plus SSE2/AVX2 versions picked at runtime
+size_t countNewlinesScalar(const char *buf, size_t len) {
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++) {
+        count += (buf[i] == '\n');
+    }
+    return count;
+}
+
+#ifdef __SSE2__
+size_t countNewlinesSSE2(const char *buf, size_t len) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+    while (len - i >= 16) {
+        // Each byte lane counts up to 255 hits before it is summed with psadbw
+        size_t blocks = (len - i) / 16;
+        if (blocks > 255) blocks = 255;
+        __m128i acc = _mm_setzero_si128();
+        for (size_t b = 0; b < blocks; b++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+        }
+        __m128i sums = _mm_sad_epu8(acc, _mm_setzero_si128());
+        count += (size_t)_mm_extract_epi16(sums, 0) + (size_t)_mm_extract_epi16(sums, 4);
+    }
+    return count + countNewlinesScalar(buf + i, len - i);
+}
+#endif
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("avx2")))
+size_t countNewlinesAVX2(const char *buf, size_t len) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+    while (len - i >= 32) {
+        size_t blocks = (len - i) / 32;
+        if (blocks > 255) blocks = 255;
+        __m256i acc = _mm256_setzero_si256();
+        for (size_t b = 0; b < blocks; b++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, nl));
+        }
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i *)lanes, _mm256_sad_epu8(acc, _mm256_setzero_si256()));
+        count += (size_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    }
+    return count + countNewlinesScalar(buf + i, len - i);
+}
+#endif
+
+size_t countNewlines(const char *buf, size_t len) {
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2")) return countNewlinesAVX2(buf, len);
+#endif
+#ifdef __SSE2__
+    return countNewlinesSSE2(buf, len);
+#else
+    return countNewlinesScalar(buf, len);
+#endif
+}
+
+// Substring search: compare the first and last needle bytes across a whole
+// vector, then memcmp() only the candidate positions
+#ifdef __SSE2__
+const char *findSubstringSSE2(const char *hay, size_t n, const char *needle, size_t m) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i bf = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i bl = _mm_loadu_si128((const __m128i *)(hay + i + m - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(bf, first), _mm_cmpeq_epi8(bl, last)));
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0) return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return memmem(hay + i, n - i, needle, m);
+}
+#endif
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("avx2")))
+const char *findSubstringAVX2(const char *hay, size_t n, const char *needle, size_t m) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i bf = _mm256_loadu_si256((const __m256i *)(hay + i));
+        __m256i bl = _mm256_loadu_si256((const __m256i *)(hay + i + m - 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(bf, first), _mm256_cmpeq_epi8(bl, last)));
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0) return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return memmem(hay + i, n - i, needle, m);
+}
+#endif
+
+const char *findSubstring(const char *hay, size_t n, const char *needle, size_t m) {
+    if (m == 0) return hay;
+    if (m > n) return NULL;
+    if (m == 1) return memchr(hay, needle[0], n);
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2")) return findSubstringAVX2(hay, n, needle, m);
+#endif
+#ifdef __SSE2__
+    return findSubstringSSE2(hay, n, needle, m);
+#else
+    return memmem(hay, n, needle, m);
+#endif
+}
+
+// Parsed form of a text builtin; anything we cannot match exactly is left
+// to the real utility
+typedef enum { TEXT_CAT, TEXT_WC, TEXT_HEAD, TEXT_GREP } TextKind;
+
+typedef struct {
+    TextKind kind;
+    int wc_lines;
+    int wc_words;
+    int wc_bytes;
+    uintmax_t head_lines;
+    const char *pattern;
+    char **files;
+    int nfiles;
+} TextCommand;
+
+int parseCount(const char *s, uintmax_t *out) {
+    if (*s == '\0') return -1;
+    uintmax_t v = 0;
+    for (; *s; s++) {
+        if (*s < '0' || *s > '9') return -1;
+        uintmax_t d = (uintmax_t)(*s - '0');
+        if (v > (UINTMAX_MAX - d) / 10) return -1;  // Too large: let the real utility report it
+        v = v * 10 + d;
+    }
+    *out = v;
+    return 0;
+}
+
+// Returns 0 if args is a builtin text command we handle, -1 otherwise
+int parseTextBuiltin(char **args, int arg_count, TextCommand *tc) {
+    int i = 1;
+    memset(tc, 0, sizeof(*tc));
+
+    if (strcmp(args[0], "cat") == 0) {
+        tc->kind = TEXT_CAT;
+    } else if (strcmp(args[0], "wc") == 0) {
+        tc->kind = TEXT_WC;
+        for (; i < arg_count && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+            if (strcmp(args[i], "--") == 0) {
+                i++;
+                break;
+            }
+            for (const char *p = args[i] + 1; *p; p++) {
+                if (*p == 'l') tc->wc_lines = 1;
+                else if (*p == 'w') tc->wc_words = 1;
+                else if (*p == 'c') tc->wc_bytes = 1;
+                else return -1;
+            }
+        }
+        if (!tc->wc_lines && !tc->wc_words && !tc->wc_bytes) {
+            tc->wc_lines = tc->wc_words = tc->wc_bytes = 1;
+        }
+    } else if (strcmp(args[0], "head") == 0) {
+        tc->kind = TEXT_HEAD;
+        tc->head_lines = 10;
+        for (; i < arg_count && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+            if (strcmp(args[i], "--") == 0) {
+                i++;
+                break;
+            }
+            if (strcmp(args[i], "-n") == 0) {
+                if (i + 1 >= arg_count || parseCount(args[i + 1], &tc->head_lines) < 0) return -1;
+                i++;
+            } else if (args[i][1] == 'n') {
+                if (parseCount(args[i] + 2, &tc->head_lines) < 0) return -1;
+            } else if (parseCount(args[i] + 1, &tc->head_lines) < 0) {
+                return -1;
+            }
+        }
+    } else if (strcmp(args[0], "grep") == 0) {
+        tc->kind = TEXT_GREP;
+        if (i >= arg_count || strcmp(args[i], "-F") != 0) return -1;
+        i++;
+        // Any further option (-i, -v, -e, ...) is left to the real grep
+        if (i < arg_count && strcmp(args[i], "--") == 0) {
+            i++;
+        } else if (i < arg_count && args[i][0] == '-' && args[i][1] != '\0') {
+            return -1;
+        }
+        if (i >= arg_count) return -1;
+        tc->pattern = args[i++];
+    } else {
+        return -1;
+    }
+
+    // Remaining operands are files; leave unknown options to the real tool
+    for (int j = i; j < arg_count; j++) {
+        if (args[j][0] == '-' && args[j][1] != '\0') return -1;
+    }
+    tc->files = args + i;
+    tc->nfiles = arg_count - i;
+    return 0;
+}
+
+int openInput(const char *name) {
+    if (strcmp(name, "-") == 0) return STDIN_FILENO;
+    return open(name, O_RDONLY);
+}
+
+void closeInput(int in) {
+    if (in != STDIN_FILENO) close(in);
+}
+
+// Copy in to out, moving data inside the kernel where possible:
+// copy_file_range() for file-to-file, splice() when either end is a pipe,
+// and plain read()/write() for everything else
+int copyFd(int in, int out) {
+    struct stat st;
+    ssize_t n;
+    int copied = 0;
+
+    if (fstat(in, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        while ((n = copy_file_range(in, NULL, out, NULL, TEXT_BUF_SIZE, 0)) != 0) {
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (copied) return -1;
+                break;
+            }
+            copied = 1;
+        }
+        if (copied && n == 0) return 0;
+    }
+
+    while ((n = splice(in, NULL, out, NULL, TEXT_BUF_SIZE, SPLICE_F_MOVE)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (copied) return -1;
+            break;
+        }
+        copied = 1;
+    }
+    if (copied && n == 0) return 0;
+
+    static char buf[TEXT_BUF_SIZE];
+    while ((n = read(in, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (writeAll(out, buf, (size_t)n) < 0) return -1;
+    }
+    return 0;
+}
+
+int catBuiltin(TextCommand *tc) {
+    char *stdin_name = "-";
+    char **files = tc->nfiles > 0 ? tc->files : &stdin_name;
+    int nfiles = tc->nfiles > 0 ? tc->nfiles : 1;
+    int status = 0;
+    struct stat out_st;
+    int out_is_reg = fstat(STDOUT_FILENO, &out_st) == 0 && S_ISREG(out_st.st_mode);
+
+    for (int i = 0; i < nfiles; i++) {
+        int in = openInput(files[i]);
+        if (in < 0) {
+            fprintf(stderr, "cat: %s: %s\n", files[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        // Same check as coreutils: refuse to grow the file we are reading
+        struct stat in_st;
+        if (out_is_reg && fstat(in, &in_st) == 0 && in_st.st_dev == out_st.st_dev &&
+            in_st.st_ino == out_st.st_ino && lseek(in, 0, SEEK_CUR) < lseek(STDOUT_FILENO, 0, SEEK_END)) {
+            fprintf(stderr, "cat: %s: input file is output file\n", files[i]);
+            status = 1;
+            closeInput(in);
+            continue;
+        }
+        if (copyFd(in, STDOUT_FILENO) < 0) {
+            fprintf(stderr, "cat: %s: %s\n", files[i], strerror(errno));
+            status = 1;
+        }
+        closeInput(in);
+    }
+    return status;
+}
+
+typedef struct {
+    uintmax_t lines;
+    uintmax_t words;
+    uintmax_t bytes;
+} WcCounts;
+
+int wcCountFd(int in, TextCommand *tc, WcCounts *c) {
+    static char buf[TEXT_BUF_SIZE];
+    struct stat st;
+    ssize_t n;
+    int in_word = 0;
+
+    // Byte count alone can come straight from the inode
+    if (!tc->wc_lines && !tc->wc_words && fstat(in, &st) == 0 && S_ISREG(st.st_mode)) {
+        off_t pos = lseek(in, 0, SEEK_CUR);
+        if (pos >= 0 && st.st_size > 0) {
+            c->bytes = pos < st.st_size ? (uintmax_t)(st.st_size - pos) : 0;
+            return 0;
+        }
+    }
+
+    while ((n = read(in, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        c->bytes += (uintmax_t)n;
+        if (!tc->wc_words) {
+            c->lines += countNewlines(buf, (size_t)n);
+            continue;
+        }
+        // C-locale rules: whitespace ends a word, a printable byte starts one
+        for (ssize_t i = 0; i < n; i++) {
+            unsigned char ch = (unsigned char)buf[i];
+            if (ch == '\n') {
+                c->lines++;
+                in_word = 0;
+            } else if (ch == ' ' || (ch >= '\t' && ch <= '\r')) {
+                in_word = 0;
+            } else if (ch > ' ' && ch < 0x7f && !in_word) {
+                c->words++;
+                in_word = 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void wcPrint(TextCommand *tc, WcCounts *c, int width, const char *name) {
+    char line[128];
+    int len = 0;
+    const char *sep = "";
+    if (tc->wc_lines) {
+        len += snprintf(line + len, sizeof(line) - len, "%s%*ju", sep, width, c->lines);
+        sep = " ";
+    }
+    if (tc->wc_words) {
+        len += snprintf(line + len, sizeof(line) - len, "%s%*ju", sep, width, c->words);
+        sep = " ";
+    }
+    if (tc->wc_bytes) {
+        len += snprintf(line + len, sizeof(line) - len, "%s%*ju", sep, width, c->bytes);
+    }
+    writeOut(line, (size_t)len);
+    if (name != NULL) {
+        writeOut(" ", 1);
+        writeOut(name, strlen(name));
+    }
+    writeOut("\n", 1);
+}
+
+int wcBuiltin(TextCommand *tc) {
+    char *stdin_name = "-";
+    char **files = tc->nfiles > 0 ? tc->files : &stdin_name;
+    int nfiles = tc->nfiles > 0 ? tc->nfiles : 1;
+    int status = 0;
+    WcCounts total = {0, 0, 0};
+
+    // Column width follows coreutils: digits of the summed sizes of the
+    // regular files that could be stat'ed, at least 7 when any of them is
+    // not a regular file, and 1 when a single count of a single input is printed
+    int width = 1;
+    if (nfiles > 1 || tc->wc_lines + tc->wc_words + tc->wc_bytes > 1) {
+        struct stat st;
+        uintmax_t regular_total = 0;
+        int minimum_width = 1;
+        for (int i = 0; i < nfiles; i++) {
+            int ok = strcmp(files[i], "-") == 0 ? fstat(STDIN_FILENO, &st) == 0 : stat(files[i], &st) == 0;
+            if (!ok) continue;
+            if (S_ISREG(st.st_mode)) regular_total += (uintmax_t)st.st_size;
+            else minimum_width = 7;
+        }
+        for (; regular_total >= 10; regular_total /= 10) width++;
+        if (width < minimum_width) width = minimum_width;
+    }
+
+    for (int i = 0; i < nfiles; i++) {
+        WcCounts c = {0, 0, 0};
+        int in = openInput(files[i]);
+        if (in < 0) {
+            flushOut();
+            fprintf(stderr, "wc: %s: %s\n", files[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        if (wcCountFd(in, tc, &c) < 0) {
+            flushOut();
+            fprintf(stderr, "wc: %s: %s\n", files[i], strerror(errno));
+            status = 1;
+        }
+        closeInput(in);
+        wcPrint(tc, &c, width, tc->nfiles > 0 ? files[i] : NULL);
+        total.lines += c.lines;
+        total.words += c.words;
+        total.bytes += c.bytes;
+    }
+    if (nfiles > 1) wcPrint(tc, &total, width, "total");
+    return status;
+}
+
+int headBuiltin(TextCommand *tc) {
+    static char buf[TEXT_BUF_SIZE];
+    char *stdin_name = "-";
+    char **files = tc->nfiles > 0 ? tc->files : &stdin_name;
+    int nfiles = tc->nfiles > 0 ? tc->nfiles : 1;
+    int status = 0;
+    int printed_header = 0;
+
+    for (int i = 0; i < nfiles; i++) {
+        int in = openInput(files[i]);
+        if (in < 0) {
+            flushOut();
+            fprintf(stderr, "head: cannot open '%s' for reading: %s\n", files[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        if (nfiles > 1) {
+            const char *name = in == STDIN_FILENO ? "standard input" : files[i];
+            if (printed_header) writeOut("\n", 1);
+            writeOut("==> ", 4);
+            writeOut(name, strlen(name));
+            writeOut(" <==\n", 5);
+            printed_header = 1;
+        }
+
+        uintmax_t remaining = tc->head_lines;
+        ssize_t n = 0;
+        while (remaining > 0 && (n = read(in, buf, sizeof(buf))) != 0) {
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            const char *p = buf;
+            const char *end = buf + n;
+            while (remaining > 0 && (p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+                p++;
+                remaining--;
+            }
+            writeOut(buf, (size_t)((remaining == 0 ? p : end) - buf));
+        }
+        if (n < 0) {
+            flushOut();
+            fprintf(stderr, "head: error reading '%s': %s\n", files[i], strerror(errno));
+            status = 1;
+        }
+        closeInput(in);
+    }
+    return status;
+}
+
+// Emit every line of buf[0, len) that contains the pattern; buf holds only
+// whole lines. Returns the number of matching lines.
+uintmax_t grepLines(const char *buf, size_t len, TextCommand *tc, size_t patlen, const char *label) {
+    uintmax_t matches = 0;
+    const char *p = buf;
+    const char *end = buf + len;
+    while (p < end) {
+        const char *hit = findSubstring(p, (size_t)(end - p), tc->pattern, patlen);
+        if (hit == NULL) break;
+        const char *start = memrchr(p, '\n', (size_t)(hit - p));
+        start = start ? start + 1 : p;
+        const char *stop = memchr(hit, '\n', (size_t)(end - hit));
+        stop = stop ? stop + 1 : end;
+        if (label != NULL) {
+            writeOut(label, strlen(label));
+            writeOut(":", 1);
+        }
+        writeOut(start, (size_t)(stop - start));
+        matches++;
+        p = stop;
+    }
+    return matches;
+}
+
+int grepBuiltin(TextCommand *tc) {
+    char *stdin_name = "-";
+    char **files = tc->nfiles > 0 ? tc->files : &stdin_name;
+    int nfiles = tc->nfiles > 0 ? tc->nfiles : 1;
+    size_t patlen = strlen(tc->pattern);
+    size_t cap = TEXT_BUF_SIZE;
+    char *buf = (char *)malloc(cap);
+    int error = 0;
+    int matched = 0;
+
+    if (buf == NULL) {
+        perror("Memory allocation failed");
+        return 2;
+    }
+
+    for (int i = 0; i < nfiles; i++) {
+        int in = openInput(files[i]);
+        const char *name = in == STDIN_FILENO ? "(standard input)" : files[i];
+        if (in < 0) {
+            flushOut();
+            fprintf(stderr, "grep: %s: %s\n", files[i], strerror(errno));
+            error = 1;
+            continue;
+        }
+
+        const char *label = nfiles > 1 ? name : NULL;
+        size_t have = 0;
+        int binary = 0;
+        int eof = 0;
+        while (!eof) {
+            if (have == cap) {
+                // A single line longer than the buffer: grow it
+                char *grown = (char *)realloc(buf, cap * 2);
+                if (grown == NULL) {
+                    perror("Memory reallocation failed");
+                    error = 1;
+                    break;
+                }
+                buf = grown;
+                cap *= 2;
+            }
+            ssize_t n = read(in, buf + have, cap - have);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                flushOut();
+                fprintf(stderr, "grep: %s: %s\n", name, strerror(errno));
+                error = 1;
+                break;
+            }
+            if (n == 0) {
+                eof = 1;
+            } else {
+                if (!binary && memchr(buf + have, '\0', (size_t)n) != NULL) binary = 1;
+                have += (size_t)n;
+            }
+
+            // Process complete lines; at EOF the unterminated tail counts too
+            size_t done;
+            if (eof) {
+                // grep prints an unterminated last line with a newline added;
+                // the read above left at least one free byte for it
+                if (have > 0 && buf[have - 1] != '\n') buf[have++] = '\n';
+                done = have;
+            } else {
+                const char *last_nl = memrchr(buf, '\n', have);
+                if (last_nl == NULL) continue;
+                done = (size_t)(last_nl - buf) + 1;
+            }
+            if (binary) {
+                // Like GNU grep, report binary matches instead of printing them
+                if (findSubstring(buf, done, tc->pattern, patlen) != NULL) {
+                    flushOut();
+                    fprintf(stderr, "grep: %s: binary file matches\n", name);
+                    matched = 1;
+                    break;
+                }
+            } else {
+                if (grepLines(buf, done, tc, patlen, label) > 0) matched = 1;
+            }
+            memmove(buf, buf + done, have - done);
+            have -= done;
+        }
+        closeInput(in);
+    }
+    free(buf);
+    if (error) return 2;
+    return matched ? 0 : 1;
+}
+
+int runTextBuiltin(TextCommand *tc) {
+    int status;
+    switch (tc->kind) {
+    case TEXT_CAT:  status = catBuiltin(tc); break;
+    case TEXT_WC:   status = wcBuiltin(tc); break;
+    case TEXT_HEAD: status = headBuiltin(tc); break;
+    default:        status = grepBuiltin(tc); break;
+    }
+    if (flushOut() < 0) {
+        fprintf(stderr, "%s: write error: %s\n", tc->kind == TEXT_CAT ? "cat" :
+                tc->kind == TEXT_WC ? "wc" : tc->kind == TEXT_HEAD ? "head" : "grep", strerror(errno));
+        status = tc->kind == TEXT_GREP ? 2 : 1;
+    }
+    return status;
+}
+
+// Glob expansion: every path segment is compiled once into a list of ops,
+// and directories are read in bulk with getdents64() so d_type saves a stat()
+typedef enum { GLOB_LITERAL, GLOB_ANY, GLOB_STAR, GLOB_CLASS } GlobOpKind;
+
+typedef struct {
+    GlobOpKind kind;
+    const char *lit;         // GLOB_LITERAL: unescaped bytes
+    size_t len;
+    unsigned char set[32];   // GLOB_CLASS: one bit per byte value
+} GlobOp;
+
+typedef struct {
+    char *text;       // Unescaped literal bytes of the segment
+    GlobOp *ops;
+    int nops;
+    int literal;      // No wildcards: joined to the path without reading the directory
+    int recursive;    // "**": zero or more directories
+    int match_dot;    // Starts with a literal '.', so hidden names may match
+    int has_star;
+    size_t min_len;   // Shortest name that can match
+} GlobSegment;
+
+typedef struct {
+    GlobSegment *segs;
+    int nsegs;
+    int dirs_only;    // Pattern ended in '/'
+    char path[PATH_MAX];
+    ArgList *out;
+    int matches;
+    char *dirent_buf;  // Reused by every scan, since no two directories are read at once
+} GlobState;
+
+// What globScan() does with an entry once its directory is closed
+enum { GLOB_ENT_ADD = 1, GLOB_ENT_STEP = 2, GLOB_ENT_DESCEND = 4 };
+
+typedef struct {
+    size_t name;      // Offset of the name in the scan's name pool
+    size_t len;
+    int flags;
+} GlobEntry;
+
+typedef struct {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} GlobDirent;
+
+typedef int (*CharClassFn)(int);
+
+// Look up a POSIX class name from [:name:]; NULL if it is not one
+CharClassFn globCharClass(const char *name, size_t len) {
+    static const struct {
+        const char *name;
+        CharClassFn fn;
+    } classes[] = {
+        { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank }, { "cntrl", iscntrl },
+        { "digit", isdigit }, { "graph", isgraph }, { "lower", islower }, { "print", isprint },
+        { "punct", ispunct }, { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+    };
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strlen(classes[i].name) == len && memcmp(classes[i].name, name, len) == 0) return classes[i].fn;
+    }
+    return NULL;
+}
+
+// Parse a [...] class starting at s[i]; returns the index of the closing ']'
+// or 0 if the bracket is unterminated (or names an unknown [:class:]) and
+// should be taken literally
+size_t parseGlobClass(const char *s, size_t i, size_t n, unsigned char *set) {
+    size_t j = i + 1;
+    int negate = 0;
+    memset(set, 0, 32);
+    if (j < n && (s[j] == '!' || s[j] == '^')) {
+        negate = 1;
+        j++;
+    }
+    size_t first = j;
+    for (; j < n; j++) {
+        if (s[j] == ']' && j > first) break;
+        if (s[j] == '[' && j + 1 < n && s[j + 1] == ':') {
+            // POSIX class such as [:alpha:]; the shell runs in the C locale
+            const char *end = memmem(s + j + 2, n - j - 2, ":]", 2);
+            CharClassFn fn = end ? globCharClass(s + j + 2, (size_t)(end - (s + j + 2))) : NULL;
+            if (fn == NULL) return 0;
+            for (unsigned c = 0; c < 128; c++) {
+                if (fn((int)c)) set[c >> 3] |= (unsigned char)(1u << (c & 7));
+            }
+            j = (size_t)(end - s) + 1;
+            continue;
+        }
+        unsigned char lo = (unsigned char)s[j];
+        unsigned char hi = lo;
+        if (j + 2 < n && s[j + 1] == '-' && s[j + 2] != ']') {
+            hi = (unsigned char)s[j + 2];
+            j += 2;
+        }
+        for (unsigned c = lo; c <= hi; c++) set[c >> 3] |= (unsigned char)(1u << (c & 7));
+    }
+    if (j >= n) return 0;
+    if (negate) {
+        for (int k = 0; k < 32; k++) set[k] = (unsigned char)~set[k];
+    }
+    return j;
+}
+
+void compileGlobSegment(const char *s, size_t n, GlobSegment *seg) {
+    memset(seg, 0, sizeof(*seg));
+    seg->ops = (GlobOp *)malloc((n + 1) * sizeof(GlobOp));
+    seg->text = (char *)malloc(n + 1);
+    if (seg->ops == NULL || seg->text == NULL) {
+        perror("Memory allocation failed");
+        exit(1);
+    }
+    size_t tlen = 0;
+
+    if (n == 2 && s[0] == '*' && s[1] == '*') {
+        seg->recursive = 1;
+        seg->text[0] = '\0';
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        GlobOp *op = &seg->ops[seg->nops];
+        size_t end;
+        if (s[i] == '*') {
+            if (seg->nops == 0 || seg->ops[seg->nops - 1].kind != GLOB_STAR) {
+                op->kind = GLOB_STAR;
+                seg->nops++;
+            }
+            seg->has_star = 1;
+        } else if (s[i] == '?') {
+            op->kind = GLOB_ANY;
+            seg->nops++;
+            seg->min_len++;
+        } else if (s[i] == '[' && (end = parseGlobClass(s, i, n, op->set)) != 0) {
+            op->kind = GLOB_CLASS;
+            seg->nops++;
+            seg->min_len++;
+            i = end;
+        } else {
+            char c = s[i];
+            if (c == '\\' && i + 1 < n) c = s[++i];
+            GlobOp *prev = seg->nops > 0 ? &seg->ops[seg->nops - 1] : NULL;
+            if (prev == NULL || prev->kind != GLOB_LITERAL) {
+                op->kind = GLOB_LITERAL;
+                op->lit = seg->text + tlen;
+                op->len = 0;
+                prev = op;
+                seg->nops++;
+            }
+            seg->text[tlen++] = c;
+            prev->len++;
+            seg->min_len++;
+        }
+    }
+    seg->text[tlen] = '\0';
+    seg->literal = seg->nops == 0 || (seg->nops == 1 && seg->ops[0].kind == GLOB_LITERAL);
+    seg->match_dot = seg->nops > 0 && seg->ops[0].kind == GLOB_LITERAL && seg->ops[0].lit[0] == '.';
+}
+
+int globMatch(const GlobSegment *seg, const char *name, size_t len) {
+    if (len < seg->min_len || (!seg->has_star && len != seg->min_len)) return 0;
+    if (name[0] == '.' && !seg->match_dot) return 0;
+    // Most patterns end in a literal ("*.c"): reject on it before backtracking
+    const GlobOp *tail = &seg->ops[seg->nops - 1];
+    if (tail->kind == GLOB_LITERAL && memcmp(name + len - tail->len, tail->lit, tail->len) != 0) return 0;
+
+    int op = 0;
+    size_t pos = 0;
+    int star_op = -1;
+    size_t star_pos = 0;
+    while (op < seg->nops || pos < len) {
+        if (op < seg->nops) {
+            const GlobOp *g = &seg->ops[op];
+            unsigned char c = pos < len ? (unsigned char)name[pos] : 0;
+            if (g->kind == GLOB_STAR) {
+                star_op = op++;
+                star_pos = pos;
+                continue;
+            } else if (g->kind == GLOB_ANY && pos < len) {
+                op++;
+                pos++;
+                continue;
+            } else if (g->kind == GLOB_CLASS && pos < len && (g->set[c >> 3] & (1u << (c & 7)))) {
+                op++;
+                pos++;
+                continue;
+            } else if (g->kind == GLOB_LITERAL && len - pos >= g->len &&
+                       memcmp(name + pos, g->lit, g->len) == 0) {
+                op++;
+                pos += g->len;
+                continue;
+            }
+        }
+        // Mismatch: let the last '*' swallow one more byte and retry
+        if (star_op < 0 || star_pos >= len) return 0;
+        op = star_op + 1;
+        pos = ++star_pos;
+    }
+    return 1;
+}
+
+// Append name to the path; returns the new length or 0 if it does not fit
+size_t globJoin(GlobState *gs, size_t plen, const char *name, size_t len) {
+    size_t sep = (plen > 0 && gs->path[plen - 1] != '/') ? 1 : 0;
+    if (plen + sep + len + 2 > sizeof(gs->path)) return 0;
+    if (sep) gs->path[plen] = '/';
+    memcpy(gs->path + plen + sep, name, len);
+    gs->path[plen + sep + len] = '\0';
+    return plen + sep + len;
+}
+
+void globAdd(GlobState *gs, size_t plen, int slash) {
+    if (slash && gs->path[plen - 1] != '/') {
+        gs->path[plen] = '/';
+        gs->path[plen + 1] = '\0';
+    }
+    addArg(gs->out, gs->path);
+    gs->path[plen] = '\0';
+    gs->matches++;
+}
+
+int globIsDir(int dirfd, const char *name, unsigned char type, int follow) {
+    struct stat st;
+    if (type == DT_DIR) return 1;
+    if (type != DT_UNKNOWN && (type != DT_LNK || !follow)) return 0;
+    if (fstatat(dirfd, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) != 0) return 0;
+    return S_ISDIR(st.st_mode);
+}
+
+void globScan(GlobState *gs, size_t plen, int k);
+
+// Continue matching at segment k with gs->path[0, plen) already matched
+void globStep(GlobState *gs, size_t plen, int k) {
+    GlobSegment *seg = &gs->segs[k];
+    if (!seg->literal) {
+        // A trailing "**" also matches the directory it starts from ("dir/")
+        struct stat st;
+        if (seg->recursive && k == gs->nsegs - 1 && plen > 0 && stat(gs->path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            globAdd(gs, plen, 1);
+        }
+        globScan(gs, plen, k);
+        return;
+    }
+    size_t nlen = globJoin(gs, plen, seg->text, strlen(seg->text));
+    if (nlen == 0) return;
+    if (k < gs->nsegs - 1) {
+        globStep(gs, nlen, k + 1);
+    } else {
+        struct stat st;
+        int found = gs->dirs_only ? stat(gs->path, &st) == 0 && S_ISDIR(st.st_mode)
+                                  : lstat(gs->path, &st) == 0;
+        if (found) globAdd(gs, nlen, gs->dirs_only);
+    }
+    gs->path[plen] = '\0';
+}
+
+// Read the directory at gs->path once: entries are matched against segment
+// k (or k + 1 when k is "**"), and "**" also descends into subdirectories.
+// The directory is closed before recursing, so walks of any depth hold one fd.
+void globScan(GlobState *gs, size_t plen, int k) {
+    GlobSegment *seg = &gs->segs[k];
+    int last = k == gs->nsegs - 1;
+    int match_k = seg->recursive ? k + 1 : k;
+    GlobSegment *match = match_k < gs->nsegs ? &gs->segs[match_k] : NULL;
+
+    if (seg->recursive && match != NULL && match->literal) {
+        globStep(gs, plen, match_k);  // Literal after "**" needs no listing
+        match = NULL;
+    }
+
+    int fd = open(plen > 0 ? gs->path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    if (gs->dirent_buf == NULL) {
+        gs->dirent_buf = (char *)malloc(GLOB_DIRENT_BUF);
+        if (gs->dirent_buf == NULL) {
+            perror("Memory allocation failed");
+            exit(1);
+        }
+    }
+
+    GlobEntry *ents = NULL;
+    int nents = 0, ents_cap = 0;
+    char *names = NULL;
+    size_t names_len = 0, names_cap = 0;
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, gs->dirent_buf, GLOB_DIRENT_BUF)) > 0) {
+        for (long off = 0; off < n;) {
+            GlobDirent *d = (GlobDirent *)(gs->dirent_buf + off);
+            off += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+            size_t len = strlen(name);
+            int flags = 0;
+            if (seg->recursive && last && name[0] != '.') {
+                if (!gs->dirs_only || globIsDir(fd, name, d->d_type, 1)) flags |= GLOB_ENT_ADD;
+            } else if (match != NULL && globMatch(match, name, len)) {
+                if (match_k == gs->nsegs - 1) {
+                    if (!gs->dirs_only || globIsDir(fd, name, d->d_type, 1)) flags |= GLOB_ENT_ADD;
+                } else if (globIsDir(fd, name, d->d_type, 1)) {
+                    flags |= GLOB_ENT_STEP;
+                }
+            }
+            if (seg->recursive && name[0] != '.' && globIsDir(fd, name, d->d_type, 0)) flags |= GLOB_ENT_DESCEND;
+            if (flags == 0) continue;
+
+            if (nents == ents_cap) {
+                ents_cap = ents_cap ? ents_cap * 2 : 16;
+                ents = (GlobEntry *)realloc(ents, ents_cap * sizeof(GlobEntry));
+                if (ents == NULL) {
+                    perror("Memory reallocation failed");
+                    exit(1);
+                }
+            }
+            if (names_len + len + 1 > names_cap) {
+                names_cap = names_cap ? names_cap * 2 : 1024;
+                if (names_cap < names_len + len + 1) names_cap = names_len + len + 1;
+                names = (char *)realloc(names, names_cap);
+                if (names == NULL) {
+                    perror("Memory reallocation failed");
+                    exit(1);
+                }
+            }
+            memcpy(names + names_len, name, len + 1);
+            ents[nents++] = (GlobEntry){ names_len, len, flags };
+            names_len += len + 1;
+        }
+    }
+    close(fd);
+
+    for (int i = 0; i < nents; i++) {
+        size_t nlen = globJoin(gs, plen, names + ents[i].name, ents[i].len);
+        if (nlen == 0) continue;
+        if (ents[i].flags & GLOB_ENT_ADD) globAdd(gs, nlen, gs->dirs_only);
+        if (ents[i].flags & GLOB_ENT_STEP) globStep(gs, nlen, match_k + 1);
+        if (ents[i].flags & GLOB_ENT_DESCEND) globScan(gs, nlen, k);
+        gs->path[plen] = '\0';
+    }
+    free(ents);
+    free(names);
+}
+
+typedef struct {
+    uint64_t key;   // First 8 bytes, big-endian, so most comparisons skip strcmp()
+    char *name;
+} GlobSortItem;
+
+int compareGlobItems(const void *a, const void *b) {
+    const GlobSortItem *x = (const GlobSortItem *)a;
+    const GlobSortItem *y = (const GlobSortItem *)b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+void sortGlobMatches(char **items, int count) {
+    GlobSortItem *sorted = (GlobSortItem *)malloc(count * sizeof(GlobSortItem));
+    if (sorted == NULL) {
+        perror("Memory allocation failed");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        uint64_t key = 0;
+        const unsigned char *p = (const unsigned char *)items[i];
+        for (int b = 0; b < 8; b++) {
+            key = (key << 8) | *p;
+            if (*p != '\0') p++;
+        }
+        sorted[i].key = key;
+        sorted[i].name = items[i];
+    }
+    qsort(sorted, count, sizeof(GlobSortItem), compareGlobItems);
+    for (int i = 0; i < count; i++) items[i] = sorted[i].name;
+    free(sorted);
+}
+
+// Expand pattern into al in byte order. Returns the number of matches; 0 means
+// the word had no wildcards or matched nothing, and is left to the caller.
+int expandGlob(const char *pattern, ArgList *al) {
+    if (strpbrk(pattern, "*?[") == NULL) return 0;
+
+    GlobState *gs = (GlobState *)malloc(sizeof(GlobState));
+    size_t n = strlen(pattern);
+    if (gs == NULL) {
+        perror("Memory allocation failed");
+        exit(1);
+    }
+    gs->segs = (GlobSegment *)malloc((n / 2 + 1) * sizeof(GlobSegment));
+    if (gs->segs == NULL) {
+        perror("Memory allocation failed");
+        exit(1);
+    }
+    gs->nsegs = 0;
+    gs->dirs_only = n > 0 && pattern[n - 1] == '/';
+    gs->out = al;
+    gs->matches = 0;
+    gs->dirent_buf = NULL;
+
+    int wild = 0;
+    for (size_t i = 0; i < n;) {
+        size_t j = i;
+        while (j < n && pattern[j] != '/') j++;
+        if (j > i) {
+            GlobSegment *seg = &gs->segs[gs->nsegs];
+            compileGlobSegment(pattern + i, j - i, seg);
+            if (seg->recursive && gs->nsegs > 0 && gs->segs[gs->nsegs - 1].recursive) {
+                free(seg->ops);  // "**/**" is the same as "**"
+                free(seg->text);
+            } else {
+                wild |= !seg->literal;
+                gs->nsegs++;
+            }
+        }
+        i = j + 1;
+    }
+
+    if (wild) {
+        size_t plen = 0;
+        if (pattern[0] == '/') {
+            gs->path[0] = '/';
+            plen = 1;
         }
+        gs->path[plen] = '\0';
+        int first = al->size;
+        globStep(gs, plen, 0);
+        sortGlobMatches(al->items + first, gs->matches);
     }
-    return NULL;
-}
 
-void freeVarTable(VarTable *vt) {
-    for (int i = 0; i < vt->size; i++) {
-        free(vt->names[i]);
-        free(vt->values[i]);
+    int matches = gs->matches;
+    for (int i = 0; i < gs->nsegs; i++) {
+        free(gs->segs[i].ops);
+        free(gs->segs[i].text);
     }
-    free(vt->names);
-    free(vt->values);
+    free(gs->dirent_buf);
+    free(gs->segs);
+    free(gs);
+    return matches;
 }
 
-// Execute a single command (with redirection if specified)
-void executeCommand(char **args, int arg_count, VarTable *vt, int *pipefd, int pipe_out, int pipe_in) {
-    char *cmd_args[64];
-    int cmd_arg_count = 0;
+// Execute a single command (with redirection if specified), returning its exit status.
+// pipefd[0] is the read end from the previous stage, pipefd[1] the write end to the next.
+// Runs in the stage's child, so args[arg_count] may be overwritten to terminate the list.
+int executeCommand(char **args, int arg_count, VarTable *vt, int *pipefd, int pipe_out, int pipe_in) {
+    char **cmd_args = args;
+    int cmd_arg_count = arg_count;
     int fd = -1;
     int append = 0;
+    TextCommand tc;
 
     // Parse for redirection
     for (int i = 0; i < arg_count; i++) {
         if (strcmp(args[i], ">") == 0 || strcmp(args[i], ">>") == 0) {
             if (i + 1 >= arg_count) {
                 printf("Invalid command\n");
-                return;
+                return 1;
             }
             if (strcmp(args[i], ">>") == 0) append = 1;
             fd = open(args[i + 1], O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
             if (fd < 0) {
                 perror("File open failed");
-                return;
+                return 1;
             }
+            cmd_arg_count = i;
             break;
         }
-        cmd_args[cmd_arg_count] = args[i];
-        cmd_arg_count++;
     }
     cmd_args[cmd_arg_count] = NULL;
 
@@ -105,26 +1239,38 @@ void executeCommand(char **args, int arg_count, VarTable *vt, int *pipefd, int p
         }
         printf("\n");
         if (fd >= 0) close(fd);
-        return;
+        return 0;
     } else if (strcmp(cmd_args[0], "pwd") == 0) {
         if (pipe_out) dup2(pipefd[1], STDOUT_FILENO);
         if (pipe_in) dup2(pipefd[0], STDIN_FILENO);
         if (fd >= 0) dup2(fd, STDOUT_FILENO);
         char cwd[1024];
+        int status = 0;
         if (getcwd(cwd, sizeof(cwd)) != NULL) {
             printf("%s\n", cwd);
         } else {
             perror("getcwd() error");
+            status = 1;
         }
         if (fd >= 0) close(fd);
-        return;
+        return status;
     } else if (strcmp(cmd_args[0], "cd") == 0) {
         if (cmd_arg_count == 1) {
             chdir(getenv("HOME"));
         } else if (chdir(cmd_args[1]) != 0) {
             perror("cd failed");
+            return 1;
         }
-        return;
+        return 0;
+    } else if (parseTextBuiltin(cmd_args, cmd_arg_count, &tc) == 0) {
+        // cat, wc, head and grep -F run right here instead of fork+exec
+        if (pipe_out) dup2(pipefd[1], STDOUT_FILENO);
+        if (pipe_in) dup2(pipefd[0], STDIN_FILENO);
+        if (fd >= 0) dup2(fd, STDOUT_FILENO);
+        if (pipe_out) close(pipefd[1]);
+        if (pipe_in) close(pipefd[0]);
+        if (fd >= 0) close(fd);
+        return runTextBuiltin(&tc);
     }
 
     // External command
@@ -135,13 +1281,11 @@ void executeCommand(char **args, int arg_count, VarTable *vt, int *pipefd, int p
     } else if (pid == 0) {
         if (pipe_out) {
             dup2(pipefd[1], STDOUT_FILENO);
-            close(pipefd[0]);
             close(pipefd[1]);
         }
         if (pipe_in) {
             dup2(pipefd[0], STDIN_FILENO);
             close(pipefd[0]);
-            close(pipefd[1]);
         }
         if (fd >= 0) {
             dup2(fd, STDOUT_FILENO);
@@ -152,15 +1296,811 @@ void executeCommand(char **args, int arg_count, VarTable *vt, int *pipefd, int p
         exit(1);
     }
     if (fd >= 0) close(fd);
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0) return 1;
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
+
+// Drop the backslashes the glob matcher reads as escapes, so "\*" reaches the
+// command as "*" even when files match "*"
+void unescapeWord(char *word) {
+    char *w = word;
+    for (const char *r = word; *r; r++) {
+        if (*r == '\\' && r[1] != '\0') r++;
+        *w++ = *r;
+    }
+    *w = '\0';
+}
+
+// Split a command line into arguments, expanding glob patterns if expand is set;
+// returns the argument count
+int parseCommandLine(char *command, ArgList *al, int expand) {
+    initArgList(al);
+    char *token = strtok(command, " ");
+    int assignment = token != NULL && strchr(token, '=') != NULL;
+    while (token != NULL) {
+        if (!expand || assignment || expandGlob(token, al) == 0) {
+            // Not a pattern, or nothing matched. An escaped operator keeps its
+            // backslash, since without one it would split the line.
+            int op = token[0] == '\\' && (strcmp(token + 1, "|") == 0 || strcmp(token + 1, ">") == 0 ||
+                                          strcmp(token + 1, ">>") == 0);
+            if (!op) unescapeWord(token);
+            addArg(al, token);
+        }
+        token = strtok(NULL, " ");
+    }
+    int count = al->size;
+    if (count == 0) freeArgList(al);
+    return count;
+}
+
+#define LINE_EXIT     -1  // "exit": end the shell or session
+#define LINE_PIPELINE -2  // Not a state builtin; run it with runPipeline()
+
+// Handle the commands that change shell state: assignments, exit, export and cd.
+// exports is NULL for the interactive shell, which exports into its own environment.
+int runStateBuiltin(char **args, int arg_count, VarTable *vt, VarTable *exports, FILE *out, FILE *err) {
+    // Handle variable assignment
+    if (strchr(args[0], '=') != NULL) {
+        char *eq = strchr(args[0], '=');
+        *eq = '\0';
+        char *name = args[0];
+        char *value = eq + 1;
+        if (strlen(name) == 0 || strlen(value) == 0 || strchr(value, ' ') != NULL || strchr(name, ' ') != NULL) {
+            fprintf(out, "Invalid command\n");
+            return 1;
+        }
+        addVar(vt, name, value);
+        return 0;
+    }
+
+    if (strcmp(args[0], "exit") == 0) {
+        return LINE_EXIT;
+    } else if (strcmp(args[0], "export") == 0) {
+        if (arg_count == 2) {
+            char *eq = strchr(args[1], '=');
+            if (eq && !strchr(eq + 1, ' ') && !strchr(args[1], ' ')) {
+                *eq = '\0';
+                char *name = args[1];
+                char *value = eq + 1;
+                if (exports != NULL) {
+                    addVar(exports, name, value);
+                } else if (setenv(name, value, 1) != 0) {
+                    fprintf(err, "export failed: %s\n", strerror(errno));
+                    return 1;
+                }
+                return 0;
+            }
+        }
+        fprintf(out, "Invalid command\n");
+        return 1;
+    } else if (strcmp(args[0], "cd") == 0) {
+        // Inside a pipeline cd only affects its own stage
+        for (int i = 1; i < arg_count; i++) {
+            if (strcmp(args[i], "|") == 0) return LINE_PIPELINE;
+        }
+        if (arg_count == 1) {
+            chdir(getenv("HOME"));
+        } else if (chdir(args[1]) != 0) {
+            fprintf(err, "cd failed: %s\n", strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+    return LINE_PIPELINE;
+}
+
+// Run the commands in args joined by "|" and wait for them; returns the last stage's status
+int runPipeline(char **args, int arg_count, VarTable *vt) {
+    int pipefd[2];
+    int start = 0;
+    int prev_read = -1;
+    pid_t last_pid = -1;
+    int status = 0;
+
+    for (int i = 0; i <= arg_count; i++) {
+        if (i == arg_count || strcmp(args[i], "|") == 0) {
+            char **cmd_args = args + start;
+            int cmd_arg_count = i - start;
+
+            int pipe_out = (i < arg_count); // More commands after this one?
+            if (pipe_out) {
+                if (pipe(pipefd) < 0) {
+                    perror("Pipe failed");
+                    status = 1;
+                    break;
+                }
+            }
+
+            // Each stage reads the previous pipe and writes the new one
+            int stage_fds[2] = { prev_read, pipe_out ? pipefd[1] : -1 };
+
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid < 0) {
+                perror("Fork failed");
+                exit(1);
+            } else if (pid == 0) {
+                // Keep only our own ends so readers see EOF and writers get SIGPIPE
+                if (pipe_out) close(pipefd[0]);
+                exit(executeCommand(cmd_args, cmd_arg_count, vt, stage_fds, pipe_out, prev_read >= 0));
+            }
+            last_pid = pid;
+
+            if (prev_read >= 0) close(prev_read);
+            prev_read = -1;
+            if (pipe_out) {
+                close(pipefd[1]);
+                prev_read = pipefd[0];
+            }
+            start = i + 1;
+        }
+    }
+    if (prev_read >= 0) close(prev_read);
+
+    // Wait for all child processes
+    int wstatus;
+    pid_t pid;
+    while ((pid = wait(&wstatus)) > 0) {
+        if (pid == last_pid) {
+            status = WIFSIGNALED(wstatus) ? 128 + WTERMSIG(wstatus) : WEXITSTATUS(wstatus);
+        }
+    }
+    return status;
+}
+
+// Server mode: one process serves many clients over a Unix domain socket.
+// Each connection is a session with its own variables, exports and working
+// directory. Commands are newline-terminated lines; replies are frames:
+//   "o <len>\n<bytes>"  standard output of the running command
+//   "e <len>\n<bytes>"  standard error of the running command
+//   "x <status>\n"      the command finished with this exit status
+#define SERVER_LINE_MAX 4096          // Longest command line a client may send
+#define SERVER_READ_SIZE (64 * 1024)  // Read size for client input and command output
+#define SERVER_OUT_HIGH (1024 * 1024) // Stop reading command output above this much unsent data
+#define SERVER_IN_HIGH (1024 * 1024)  // Stop reading client input above this much queued
+#define SERVER_MAX_EVENTS 256
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+typedef enum { EV_LISTEN, EV_CLIENT, EV_STDOUT, EV_STDERR, EV_CHILD } EventKind;
+
+struct Session;
+
+// epoll_event.data.ptr points at one of these
+typedef struct {
+    EventKind kind;
+    struct Session *session;
+} EventTag;
+
+typedef struct Session {
+    int fd;                 // Client socket
+    int cwd_fd;             // Working directory, entered with fchdir() before each line
+    VarTable vars;
+    VarTable exports;
+    char *in;               // Unprocessed client input
+    size_t in_off, in_len, in_cap;
+    char *out;              // Framed replies not yet sent
+    size_t out_off, out_len, out_cap;
+    pid_t child;            // Command line being run, or 0
+    int child_fd;           // pidfd of child, -1 once reaped
+    int child_status;
+    int pipes[2];           // Read ends of the child's stdout and stderr, -1 once at EOF
+    int paused;             // Output reading stopped until the client catches up
+    int eof;                // Client closed its writing side
+    int closing;            // Close once all replies are sent
+    int dead;               // Freed after the current batch of events
+    uint32_t client_events;
+    EventTag client_tag, out_tag, err_tag, child_tag;
+    struct Session *next_dead;
+} Session;
+
+typedef struct {
+    int epfd;
+    int listen_fd;
+    int home_fd;            // Directory new sessions start in
+    int reserve_fd;         // Spare descriptor, given up to shed connections at EMFILE
+    int listen_paused;      // listen_fd left epoll until a session is freed
+    time_t last_fd_warning;
+    EventTag listen_tag;
+    Session *dead;
+    pid_t *zombies;         // Killed commands of closed sessions, not yet reaped
+    int zombie_count, zombie_cap;
+} ShellServer;
+
+void watchFd(ShellServer *srv, int op, int fd, uint32_t events, EventTag *tag) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = tag;
+    if (epoll_ctl(srv->epfd, op, fd, &ev) < 0) {
+        perror("epoll_ctl failed");
+    }
+}
+
+// Remove fd from epoll before closing it: forked stages may still hold a copy
+void unwatchClose(ShellServer *srv, int fd) {
+    epoll_ctl(srv->epfd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+}
+
+void appendOut(Session *s, const char *data, size_t len) {
+    if (s->out_off > 0 && s->out_off == s->out_len) {
+        s->out_off = s->out_len = 0;
+    }
+    if (s->out_len + len > s->out_cap) {
+        if (s->out_off > 0) {
+            memmove(s->out, s->out + s->out_off, s->out_len - s->out_off);
+            s->out_len -= s->out_off;
+            s->out_off = 0;
+        }
+        while (s->out_len + len > s->out_cap) s->out_cap *= 2;
+        s->out = (char *)realloc(s->out, s->out_cap);
+        if (s->out == NULL) {
+            perror("Memory reallocation failed");
+            exit(1);
+        }
+    }
+    memcpy(s->out + s->out_len, data, len);
+    s->out_len += len;
+}
+
+void appendFrame(Session *s, char kind, const char *data, size_t len) {
+    char header[32];
+    int n = snprintf(header, sizeof(header), "%c %zu\n", kind, len);
+    appendOut(s, header, (size_t)n);
+    appendOut(s, data, len);
+}
+
+void appendStatus(Session *s, int status) {
+    char line[32];
+    int n = snprintf(line, sizeof(line), "x %d\n", status);
+    appendOut(s, line, (size_t)n);
+}
+
+// Paused pipes leave epoll entirely, since EPOLLHUP is reported even with no events requested
+void setOutputPaused(ShellServer *srv, Session *s, int paused) {
+    if (s->paused == paused) return;
+    s->paused = paused;
+    int op = paused ? EPOLL_CTL_DEL : EPOLL_CTL_ADD;
+    if (s->pipes[0] >= 0) watchFd(srv, op, s->pipes[0], EPOLLIN, &s->out_tag);
+    if (s->pipes[1] >= 0) watchFd(srv, op, s->pipes[1], EPOLLIN, &s->err_tag);
+}
+
+void destroySession(ShellServer *srv, Session *s) {
+    if (s->dead) return;
+    s->dead = 1;
+    // Until the child is reaped its pid, and so its process group, cannot be reused
+    if (s->child > 0 && s->child_status < 0) {
+        kill(-s->child, SIGKILL);  // The command line runs in its own process group
+        if (srv->zombie_count == srv->zombie_cap) {
+            srv->zombie_cap = srv->zombie_cap ? srv->zombie_cap * 2 : 8;
+            srv->zombies = (pid_t *)realloc(srv->zombies, srv->zombie_cap * sizeof(pid_t));
+            if (srv->zombies == NULL) {
+                perror("Memory reallocation failed");
+                exit(1);
+            }
+        }
+        srv->zombies[srv->zombie_count++] = s->child;  // Reaped by sweepZombies()
+    }
+    if (s->child_fd >= 0) unwatchClose(srv, s->child_fd);
+    if (s->pipes[0] >= 0) unwatchClose(srv, s->pipes[0]);
+    if (s->pipes[1] >= 0) unwatchClose(srv, s->pipes[1]);
+    unwatchClose(srv, s->fd);
+    close(s->cwd_fd);
+    s->next_dead = srv->dead;
+    srv->dead = s;
+}
+
+// Reap killed commands without blocking; the rest stay listed for the next sweep
+void sweepZombies(ShellServer *srv) {
+    int kept = 0;
+    for (int i = 0; i < srv->zombie_count; i++) {
+        pid_t pid = waitpid(srv->zombies[i], NULL, WNOHANG);
+        if (pid == 0 || (pid < 0 && errno == EINTR)) srv->zombies[kept++] = srv->zombies[i];
+    }
+    srv->zombie_count = kept;
+}
+
+void freeSession(Session *s) {
+    freeVarTable(&s->vars);
+    freeVarTable(&s->exports);
+    free(s->in);
+    free(s->out);
+    free(s);
+}
+
+// Send queued replies; returns -1 if the session was closed
+int flushSession(ShellServer *srv, Session *s) {
+    while (s->out_off < s->out_len) {
+        ssize_t n = send(s->fd, s->out + s->out_off, s->out_len - s->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            destroySession(srv, s);
+            return -1;
+        }
+        s->out_off += (size_t)n;
+    }
+    if (s->out_off == s->out_len) {
+        s->out_off = s->out_len = 0;
+    }
+
+    int want_input = !s->eof && s->in_len - s->in_off <= SERVER_IN_HIGH;
+    uint32_t events = (want_input ? EPOLLIN : 0) | (s->out_len > 0 ? EPOLLOUT : 0);
+    if (events != s->client_events) {
+        s->client_events = events;
+        watchFd(srv, EPOLL_CTL_MOD, s->fd, events, &s->client_tag);
+    }
+    setOutputPaused(srv, s, s->out_len - s->out_off > SERVER_OUT_HIGH);
+
+    if (s->closing && s->out_len == 0 && s->child == 0) {
+        destroySession(srv, s);
+        return -1;
+    }
+    return 0;
+}
+
+// Fork a child that expands and runs the command line with the session's
+// state and output pipes
+int startCommand(ShellServer *srv, Session *s, char *line) {
+    int outp[2];
+    int errp[2];
+    if (pipe2(outp, O_CLOEXEC) < 0) return -1;
+    if (pipe2(errp, O_CLOEXEC) < 0) {
+        close(outp[0]);
+        close(outp[1]);
+        return -1;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(outp[0]);
+        close(outp[1]);
+        close(errp[0]);
+        close(errp[1]);
+        return -1;
+    } else if (pid == 0) {
+        setpgid(0, 0);  // Own process group, so a closed session can kill every stage
+        int devnull = open("/dev/null", O_RDONLY);
+        if (devnull >= 0) dup2(devnull, STDIN_FILENO);
+        dup2(outp[1], STDOUT_FILENO);
+        dup2(errp[1], STDERR_FILENO);
+#ifdef SYS_close_range
+        // Don't hold on to other sessions' sockets and pipes
+        syscall(SYS_close_range, 3, ~0U, 0);
+#endif
+        for (int i = 0; i < s->exports.size; i++) {
+            setenv(s->exports.names[i], s->exports.values[i], 1);
+        }
+        ArgList al;
+        if (parseCommandLine(line, &al, 1) == 0) exit(0);
+        // A single command needs no pipeline stage of its own
+        for (int i = 0; i < al.size; i++) {
+            if (strcmp(al.items[i], "|") == 0) exit(runPipeline(al.items, al.size, &s->vars));
+        }
+        int no_pipe[2] = { -1, -1 };
+        exit(executeCommand(al.items, al.size, &s->vars, no_pipe, 0, 0));
+    }
+
+    setpgid(pid, pid);  // Also here, in case destroySession() runs before the child does it
+    close(outp[1]);
+    close(errp[1]);
+    fcntl(outp[0], F_SETFL, O_NONBLOCK);
+    fcntl(errp[0], F_SETFL, O_NONBLOCK);
+    s->child = pid;
+    s->child_fd = (int)syscall(SYS_pidfd_open, pid, 0);
+    s->pipes[0] = outp[0];
+    s->pipes[1] = errp[0];
+    s->paused = 0;
+    watchFd(srv, EPOLL_CTL_ADD, s->pipes[0], EPOLLIN, &s->out_tag);
+    watchFd(srv, EPOLL_CTL_ADD, s->pipes[1], EPOLLIN, &s->err_tag);
+    // Without pidfd support the child is reaped once its output reaches EOF
+    if (s->child_fd >= 0) {
+        watchFd(srv, EPOLL_CTL_ADD, s->child_fd, EPOLLIN, &s->child_tag);
+    }
+    return 0;
+}
+
+// Run one command line for the session
+void runSessionLine(ShellServer *srv, Session *s, char *line) {
+    ArgList al;
+    if (fchdir(s->cwd_fd) < 0) {
+        char msg[128];
+        int n = snprintf(msg, sizeof(msg), "cd failed: %s\n", strerror(errno));
+        appendFrame(s, 'e', msg, (size_t)n);
+        appendStatus(s, 1);
+        return;
+    }
+
+    // Only split the line here: glob expansion can walk a large tree, so it
+    // runs in the command's child. cd is the one state builtin that needs it,
+    // and may only use patterns that read a bounded number of directories.
+    char *raw = strdup(line);
+    if (raw == NULL) {
+        perror("Memory allocation failed");
+        exit(1);
+    }
+    if (parseCommandLine(line, &al, 0) == 0) {
+        free(raw);
+        return;
+    }
+    if (strcmp(al.items[0], "cd") == 0) {
+        if (strstr(raw, "**") != NULL) {
+            const char *msg = "cd: ** patterns are not supported in server mode\n";
+            appendFrame(s, 'e', msg, strlen(msg));
+            appendStatus(s, 1);
+            freeArgList(&al);
+            free(raw);
+            return;
+        }
+        char *cd_line = strdup(raw);
+        if (cd_line == NULL) {
+            perror("Memory allocation failed");
+            exit(1);
+        }
+        freeArgList(&al);
+        parseCommandLine(cd_line, &al, 1);
+        free(cd_line);
+    }
+
+    char *msg_out = NULL;
+    char *msg_err = NULL;
+    size_t out_len = 0;
+    size_t err_len = 0;
+    FILE *out = open_memstream(&msg_out, &out_len);
+    FILE *err = open_memstream(&msg_err, &err_len);
+    if (out == NULL || err == NULL) {
+        perror("open_memstream failed");
+        exit(1);
+    }
+    int status = runStateBuiltin(al.items, al.size, &s->vars, &s->exports, out, err);
+    fclose(out);
+    fclose(err);
+    if (out_len > 0) appendFrame(s, 'o', msg_out, out_len);
+    if (err_len > 0) appendFrame(s, 'e', msg_err, err_len);
+    free(msg_out);
+    free(msg_err);
+
+    if (status == LINE_EXIT) {
+        appendStatus(s, 0);
+        s->closing = 1;
+    } else if (status == LINE_PIPELINE) {
+        if (startCommand(srv, s, raw) < 0) {
+            char msg[128];
+            int n = snprintf(msg, sizeof(msg), "Fork failed: %s\n", strerror(errno));
+            appendFrame(s, 'e', msg, (size_t)n);
+            appendStatus(s, 1);
+        }
+    } else {
+        if (strcmp(al.items[0], "cd") == 0) {
+            int fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd >= 0) {
+                close(s->cwd_fd);
+                s->cwd_fd = fd;
+            }
+        }
+        appendStatus(s, status);
+    }
+    freeArgList(&al);
+    free(raw);
+}
+
+// Run queued lines until one needs a child process or the input runs out
+void advanceSession(ShellServer *srv, Session *s) {
+    while (s->child == 0 && !s->closing) {
+        char *line = s->in + s->in_off;
+        size_t avail = s->in_len - s->in_off;
+        char *nl = memchr(line, '\n', avail);
+        if (nl == NULL) {
+            if (avail > SERVER_LINE_MAX) {
+                const char *msg = "Command line too long\n";
+                appendFrame(s, 'e', msg, strlen(msg));
+                appendStatus(s, 1);
+                s->closing = 1;
+            } else if (s->eof) {
+                s->closing = 1;
+            }
+            break;
+        }
+        *nl = '\0';
+        s->in_off += (size_t)(nl - line) + 1;
+        runSessionLine(srv, s, line);
+    }
+    if (s->in_off == s->in_len) {
+        s->in_off = s->in_len = 0;
+    }
+    flushSession(srv, s);
+}
+
+// Once the child has exited and its output is drained, report its status
+void finishCommand(ShellServer *srv, Session *s) {
+    if (s->child == 0 || s->pipes[0] >= 0 || s->pipes[1] >= 0) return;
+    if (s->child_fd >= 0) return;  // Still running
+    if (s->child_status < 0) {
+        int wstatus;
+        waitpid(s->child, &wstatus, 0);
+        s->child_status = WIFSIGNALED(wstatus) ? 128 + WTERMSIG(wstatus) : WEXITSTATUS(wstatus);
+    }
+    appendStatus(s, s->child_status);
+    s->child = 0;
+    s->child_status = -1;
+    advanceSession(srv, s);
+}
+
+// Out of descriptors: the listen fd stays readable, so accept the pending
+// connection with the reserve fd and drop it instead of spinning on EMFILE.
+// Returns -1 if even that failed and accepting has been paused.
+int shedConnection(ShellServer *srv, int err) {
+    time_t now = time(NULL);
+    if (now != srv->last_fd_warning) {
+        srv->last_fd_warning = now;
+        fprintf(stderr, "accept failed: %s, dropping connections\n", strerror(err));
+    }
+    if (srv->reserve_fd >= 0) {
+        close(srv->reserve_fd);
+        srv->reserve_fd = -1;
+        int fd = accept4(srv->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd >= 0) close(fd);
+        srv->reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (fd >= 0 || errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+    }
+    // No spare descriptor: stop watching listen_fd until a session closes
+    epoll_ctl(srv->epfd, EPOLL_CTL_DEL, srv->listen_fd, NULL);
+    srv->listen_paused = 1;
+    return -1;
+}
+
+void acceptClients(ShellServer *srv) {
+    while (1) {
+        int fd = accept4(srv->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EMFILE || errno == ENFILE) {
+                if (shedConnection(srv, errno) == 0) continue;
+                return;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept failed");
+            return;
+        }
+        int cwd_fd = fcntl(srv->home_fd, F_DUPFD_CLOEXEC, 0);
+        if (cwd_fd < 0) {
+            int err = errno;
+            close(fd);
+            if (shedConnection(srv, err) < 0) return;
+            continue;
+        }
+        Session *s = (Session *)calloc(1, sizeof(Session));
+        if (s == NULL) {
+            perror("Memory allocation failed");
+            exit(1);
+        }
+        s->fd = fd;
+        s->cwd_fd = cwd_fd;
+        initVarTable(&s->vars);
+        initVarTable(&s->exports);
+        s->in_cap = SERVER_READ_SIZE;
+        s->out_cap = SERVER_READ_SIZE;
+        s->in = (char *)malloc(s->in_cap);
+        s->out = (char *)malloc(s->out_cap);
+        if (s->in == NULL || s->out == NULL) {
+            perror("Memory allocation failed");
+            exit(1);
+        }
+        s->child_fd = -1;
+        s->child_status = -1;
+        s->pipes[0] = s->pipes[1] = -1;
+        s->client_tag = (EventTag){ EV_CLIENT, s };
+        s->out_tag = (EventTag){ EV_STDOUT, s };
+        s->err_tag = (EventTag){ EV_STDERR, s };
+        s->child_tag = (EventTag){ EV_CHILD, s };
+        s->client_events = EPOLLIN;
+        watchFd(srv, EPOLL_CTL_ADD, fd, EPOLLIN, &s->client_tag);
+    }
+}
+
+void readClient(ShellServer *srv, Session *s) {
+    while (!s->eof && s->in_len - s->in_off <= SERVER_IN_HIGH) {
+        if (s->in_off > 0 && s->in_len == s->in_cap) {
+            memmove(s->in, s->in + s->in_off, s->in_len - s->in_off);
+            s->in_len -= s->in_off;
+            s->in_off = 0;
+        }
+        if (s->in_len == s->in_cap) {
+            s->in_cap *= 2;
+            s->in = (char *)realloc(s->in, s->in_cap);
+            if (s->in == NULL) {
+                perror("Memory reallocation failed");
+                exit(1);
+            }
+        }
+        ssize_t n = read(s->fd, s->in + s->in_len, s->in_cap - s->in_len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            destroySession(srv, s);
+            return;
+        }
+        if (n == 0) {
+            s->eof = 1;
+            break;
+        }
+        s->in_len += (size_t)n;
+    }
+    // A last line without its newline still runs, as in the interactive shell
+    if (s->eof && s->in_len > s->in_off && s->in[s->in_len - 1] != '\n') {
+        if (s->in_len == s->in_cap) {
+            s->in = (char *)realloc(s->in, ++s->in_cap);
+            if (s->in == NULL) {
+                perror("Memory reallocation failed");
+                exit(1);
+            }
+        }
+        s->in[s->in_len++] = '\n';
+    }
+    advanceSession(srv, s);
+}
+
+void readCommandOutput(ShellServer *srv, Session *s, int which) {
+    static char buf[SERVER_READ_SIZE];
+    while (s->pipes[which] >= 0 && s->out_len - s->out_off <= SERVER_OUT_HIGH) {
+        ssize_t n = read(s->pipes[which], buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        }
+        if (n <= 0) {
+            unwatchClose(srv, s->pipes[which]);
+            s->pipes[which] = -1;
+            break;
+        }
+        appendFrame(s, which == 0 ? 'o' : 'e', buf, (size_t)n);
+    }
+    if (flushSession(srv, s) == 0) finishCommand(srv, s);
+}
+
+void reapCommand(ShellServer *srv, Session *s) {
+    int wstatus;
+    if (waitpid(s->child, &wstatus, WNOHANG) <= 0) return;
+    s->child_status = WIFSIGNALED(wstatus) ? 128 + WTERMSIG(wstatus) : WEXITSTATUS(wstatus);
+    unwatchClose(srv, s->child_fd);
+    s->child_fd = -1;
+    finishCommand(srv, s);
+}
+
+// Remove a socket left behind by a server that has exited; returns -1 if
+// something else is at the path, including the socket of a running server
+int removeStaleSocket(const char *path, const struct sockaddr_un *addr) {
+    struct stat st;
+    if (lstat(path, &st) < 0) {
+        if (errno == ENOENT) return 0;
+        perror("Socket path check failed");
+        return -1;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "Not a socket, refusing to replace: %s\n", path);
+        return -1;
+    }
+    // Non-blocking, so a server with a full backlog counts as running
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Socket path check failed");
+        return -1;
+    }
+    int rc = connect(fd, (const struct sockaddr *)addr, sizeof(*addr));
+    int err = errno;
+    close(fd);
+    if (rc == 0 || err != ECONNREFUSED) {
+        fprintf(stderr, "Socket in use, refusing to replace: %s\n", path);
+        return -1;
+    }
+    if (unlink(path) < 0) {
+        perror("Stale socket removal failed");
+        return -1;
+    }
+    return 0;
+}
+
+int runShellServer(const char *socket_path) {
+    ShellServer srv;
+    struct sockaddr_un addr;
+    memset(&srv, 0, sizeof(srv));
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return 1;
+    }
+
+    // Every session holds a few descriptors, so use the whole hard limit
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    srv.home_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    srv.reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    srv.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    srv.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (srv.home_fd < 0 || srv.reserve_fd < 0 || srv.listen_fd < 0 || srv.epfd < 0) {
+        perror("Server setup failed");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    if (removeStaleSocket(socket_path, &addr) < 0) return 1;
+    if (bind(srv.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(srv.listen_fd, SOMAXCONN) < 0) {
+        perror("Socket bind failed");
+        return 1;
+    }
+    srv.listen_tag = (EventTag){ EV_LISTEN, NULL };
+    watchFd(&srv, EPOLL_CTL_ADD, srv.listen_fd, EPOLLIN, &srv.listen_tag);
+    printf("Micro Shell server listening on %s\n", socket_path);
+    fflush(stdout);
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (1) {
+        // Killed commands normally exit at once, so poll briefly until they are reaped
+        int n = epoll_wait(srv.epfd, events, SERVER_MAX_EVENTS, srv.zombie_count > 0 ? 100 : -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            return 1;
+        }
+        for (int i = 0; i < n; i++) {
+            EventTag *tag = (EventTag *)events[i].data.ptr;
+            Session *s = tag->session;
+            if (tag->kind == EV_LISTEN) {
+                acceptClients(&srv);
+                continue;
+            }
+            if (s->dead) continue;
+            switch (tag->kind) {
+            case EV_CLIENT:
+                // A client that hung up completely cannot receive any replies
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) destroySession(&srv, s);
+                else if (events[i].events & EPOLLIN) readClient(&srv, s);
+                else flushSession(&srv, s);
+                break;
+            case EV_STDOUT: readCommandOutput(&srv, s, 0); break;
+            case EV_STDERR: readCommandOutput(&srv, s, 1); break;
+            case EV_CHILD:  reapCommand(&srv, s); break;
+            default: break;
+            }
+        }
+        // Sessions closed during this batch may still have had events queued in it
+        int freed = srv.dead != NULL;
+        while (srv.dead != NULL) {
+            Session *s = srv.dead;
+            srv.dead = s->next_dead;
+            freeSession(s);
+        }
+        if (srv.zombie_count > 0) sweepZombies(&srv);
+        if (freed && srv.listen_paused) {
+            if (srv.reserve_fd < 0) srv.reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            srv.listen_paused = 0;
+            watchFd(&srv, EPOLL_CTL_ADD, srv.listen_fd, EPOLLIN, &srv.listen_tag);
+        }
+    }
 }
 
 int microshell_main(int argc, char *argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--server") == 0) {
+        return runShellServer(argv[2]);
+    }
+
     VarTable vt;
     initVarTable(&vt);
 
     char command[256];
-    char *args[64];
-    int arg_count;
+    ArgList al;
 
     while (1) {
         printf("Micro Shell Prompt > ");
@@ -179,111 +2119,22 @@ int microshell_main(int argc, char *argv[]) {
 
         if (strlen(command) == 0) continue;
 
-        // Parse command into arguments
-        arg_count = 0;
-        char *token = strtok(command, " ");
-        while (token != NULL && arg_count < 63) {
-            args[arg_count] = strdup(token);
-            if (args[arg_count] == NULL) {
-                perror("Memory allocation failed");
-                exit(1);
-            }
-            arg_count++;
-            token = strtok(NULL, " ");
-        }
-        args[arg_count] = NULL;
-
-        // Handle variable assignment
-        if (strchr(args[0], '=') != NULL) {
-            char *eq = strchr(args[0], '=');
-            *eq = '\0';
-            char *name = args[0];
-            char *value = eq + 1;
-            if (strlen(name) == 0 || strlen(value) == 0 || strchr(value, ' ') != NULL || strchr(name, ' ') != NULL) {
-                printf("Invalid command\n");
-            } else {
-                addVar(&vt, name, value);
-            }
-            for (int i = 0; i < arg_count; i++) free(args[i]);
-            continue;
-        }
+        // Parse command into arguments, expanding glob patterns
+        if (parseCommandLine(command, &al, 1) == 0) continue;
 
-        // Handle built-in commands
-        if (strcmp(args[0], "exit") == 0) {
-            for (int i = 0; i < arg_count; i++) free(args[i]);
+        // Handle built-in commands that change the shell itself, then pipelines
+        int status = runStateBuiltin(al.items, al.size, &vt, NULL, stdout, stderr);
+        if (status == LINE_EXIT) {
+            freeArgList(&al);
             freeVarTable(&vt);
             printf("Good Bye :)\n");
             break;
-        } else if (strcmp(args[0], "export") == 0) {
-            if (arg_count == 2) {
-                char *eq = strchr(args[1], '=');
-                if (eq && !strchr(eq + 1, ' ') && !strchr(args[1], ' ')) {
-                    *eq = '\0';
-                    char *name = args[1];
-                    char *value = eq + 1;
-                    if (setenv(name, value, 1) != 0) {
-                        perror("export failed");
-                    }
-                } else {
-                    printf("Invalid command\n");
-                }
-            } else {
-                printf("Invalid command\n");
-            }
-            for (int i = 0; i < arg_count; i++) free(args[i]);
-            continue;
-        }
-
-        // Handle pipelines
-        int pipefd[2];
-        int start = 0;
-        int pipe_in = 0;
-
-        for (int i = 0; i <= arg_count; i++) {
-            if (i == arg_count || strcmp(args[i], "|") == 0) {
-                char *cmd_args[64];
-                int cmd_arg_count = 0;
-                for (int j = start; j < i; j++) {
-                    cmd_args[cmd_arg_count++] = args[j];
-                }
-                cmd_args[cmd_arg_count] = NULL;
-
-                int pipe_out = (i < arg_count); // More commands after this one?
-                if (pipe_out) {
-                    if (pipe(pipefd) < 0) {
-                        perror("Pipe failed");
-                        break;
-                    }
-                }
-
-                pid_t pid = fork();
-                if (pid < 0) {
-                    perror("Fork failed");
-                    exit(1);
-                } else if (pid == 0) {
-                    executeCommand(cmd_args, cmd_arg_count, &vt, pipefd, pipe_out, pipe_in);
-                    exit(0);
-                }
-
-                if (pipe_in) {
-                    close(pipefd[0]);
-                    close(pipefd[1]);
-                }
-                if (pipe_out) {
-                    close(pipefd[1]);
-                    pipe_in = 1;
-                }
-                start = i + 1;
-            }
+        } else if (status == LINE_PIPELINE) {
+            runPipeline(al.items, al.size, &vt);
         }
 
-        // Wait for all child processes
-        while (wait(NULL) > 0);
-
         // Free arguments
-        for (int i = 0; i < arg_count; i++) {
-            free(args[i]);
-        }
+        freeArgList(&al);
     }
 
     return 0;